@@ -1,121 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
-//Every LC2K file will contain less than 1000 lines of assembly.
+//Every line of an LC2K file is shorter than 1000 characters.
 #define MAXLINELENGTH 1000
-#define MAXSYMBOLS 1000
-#define MAXRELOCATIONS 1000
-#define MAXLABELS 1000
-
-/**
- * Requires: readAndParse is non-static and unmodified from project 1a. 
- *   inFilePtr and outFilePtr must be opened. 
- *   inFilePtr must be rewound before calling this function.
- * Modifies: outFilePtr
- * Effects: Prints the correct machine code for the input file. After 
- *   reading and parsing through inFilePtr, the pointer is rewound.
- *   Most project 1a error checks are done. No undefined labels of any
- *   type are checked, and these are instead resolved to 0.
-*/
-extern void print_inst_machine_code(FILE *inFilePtr, FILE *outFilePtr);
+//A program's text and data together fill at most the 65536 words of LC2K memory.
+#define MAXWORDS 65536
+//Objects in a --cache directory are keyed on the source bytes and this version. The Makefile passes a
+//checksum of the assembler's own sources as TOOL_SOURCES; other builds fall back to the build time, so a
+//changed assembler never picks up objects written by an older one.
+#ifndef TOOL_SOURCES
+#define TOOL_SOURCES __DATE__ " " __TIME__
+#endif
+#define CACHE_VERSION "LC-2K assembler " TOOL_SOURCES
+//Cache keys are 64-bit FNV-1a hashes
+#define HASH_START 0xcbf29ce484222325ULL
+
+// Interned strings are carved out of an arena of large blocks that is only freed at exit
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+// Every distinct label or opcode string is stored once, so names compare by pointer
+typedef struct InternedString {
+    struct InternedString *next; // Next string in the same hash bucket
+    uint32_t hash;
+    int symbolIndex; // Index in symbolTable, -1 if the string isn't a symbol
+    int firstRelocation; // First entry of relocationTable using it, -1 if none
+    char text[];
+} InternedString;
 
 int readAndParse(FILE *, char *, char *, char *, char *, char *);
 void checkForBlankLinesInCode(FILE *inFilePtr);
 int isNumber(char *);
 int encodeInstructionWithLabelResolution(char* opcode, char* arg0, char* arg1, char* arg2, int currentAddress);
 int findLabelAddressSymbols(char *label);
+int symbolAddress(int symbolIndex);
 int findLabelAddressRelocate(char* label);
 bool isGlobalLabel(char* label);
-int addLabelToSymbolTable(char* label, int offset, char type, bool isGlobal);
+int addLabelToSymbolTable(char* label, int address, char type, bool isGlobal);
 int isValidRegister(char* reg);
 void addEntryToRelocationTable(const char* label, int currentAddress, const char* opcode);
+void *arenaAlloc(size_t size);
+InternedString *intern(const char *text);
+InternedString *findInterned(const char *text);
+int findSymbol(const char *label);
+void recordOperandLabel(char *arg, const char *opcode, int currentAddress, bool *foundLabel, bool *addReloc,
+    int *undefinedResult);
+uint32_t hashString(const char *text);
+char *mapSource(char *fileString, size_t *size);
+int spanIsBlank(const char *line, size_t length);
+char *nextLine(char *line, char *end, int address);
+void tokenizeLine(char *line, char *lineEnd, char **label, char **opcode, char **arg0, char **arg1,
+    char **arg2);
+int isDecimal(char *string);
+int isNumberOrEmpty(char *token);
+bool encodesCleanly(char *opcode, char *arg0, char *arg1, char *arg2);
+void addFixup(char *opcode, char *arg0, char *arg1, char *arg2, int textAddress, int dataAddress,
+    int sectionIndex);
+int addWordToSection(int **section, int *size, int *capacity);
+int assembleFile(char *inFileString, char *outFileString);
+int assembleCached(char *inFileString, char *outFileString, bool isolate, bool *hit);
+int assembleDirectory(char *dirString);
+bool isSourceName(const char *name);
+int compareNames(const void *a, const void *b);
+uint64_t hashBytes(uint64_t hash, const void *bytes, size_t size);
+bool hashFile(const char *fileString, uint64_t *hash);
+bool copyFile(const char *fromString, const char *toString);
+void storeInCache(const char *fileString, const char *cacheString);
 
 typedef struct {
-    char label[MAXLINELENGTH]; // Label name
+    const char *label; // Label name, interned
     char type; // 'T' for text, 'D' for data, 'U' for undefined
-    int offset; // Offset from the start of the text or data section
+    int address; // Offset of the labelled line from the start of the text or data section
     bool isGlobal; // True if global, false if local
     bool isDefined;
 } SymbolTableEntry;
 
 typedef struct {
     int offset; // Offset from the start of the text or data section
-    char opcode[MAXLINELENGTH]; // Opcode that uses the symbol
-    char label[MAXLINELENGTH]; // Label name
+    const char *opcode; // Opcode that uses the symbol, interned
+    const char *label; // Label name, interned
 } RelocationTableEntry;
 
+// A line that is encoded once every label is known
 typedef struct {
-    char label[MAXLINELENGTH];
-} LabelTableEntry;
+    char *opcode; // The line's fields, ended in place in the source
+    char *arg0;
+    char *arg1;
+    char *arg2;
+    int textAddress; // The line's address
+    int dataAddress; // Its index among the .fill lines, for .fill relocations
+    int sectionIndex; // Where its word goes in textSection or dataSection
+} Fixup;
 
-SymbolTableEntry symbolTable[MAXSYMBOLS];
+ArenaBlock *arena = NULL;
+
+InternedString **internBuckets = NULL;
+int internBucketCount = 0; // Always a power of 2
+int internCount = 0;
+
+SymbolTableEntry *symbolTable = NULL;
 int symbolTableSize = 0;
+int symbolTableCapacity = 0;
 int symbolTablePrintSize = 0;
-RelocationTableEntry relocationTable[MAXRELOCATIONS];
+RelocationTableEntry *relocationTable = NULL;
 int relocationTableSize = 0;
+int relocationTableCapacity = 0;
+Fixup *fixupTable = NULL;
+int fixupTableSize = 0;
+int fixupTableCapacity = 0;
 
-LabelTableEntry labelTable[MAXLABELS];
-int labelTableSize = 0;
-
-int textSection[MAXLINELENGTH];
+int *textSection = NULL;
 int textSectionSize = 0;
-int dataSection[MAXLINELENGTH];
+int textSectionCapacity = 0;
+int *dataSection = NULL;
 int dataSectionSize = 0;
+int dataSectionCapacity = 0;
+
+char *cacheDirString = NULL; // --cache directory, NULL if objects aren't cached
 
 int
 main(int argc, char **argv)
 {
-    char *inFileString, *outFileString;
-    FILE *inFilePtr, *outFilePtr;
-    char label[MAXLINELENGTH], opcode[MAXLINELENGTH], arg0[MAXLINELENGTH],
-            arg1[MAXLINELENGTH], arg2[MAXLINELENGTH];
-
-    if (argc != 3) {
-        printf("error: usage: %s <assembly-code-file> <machine-code-file>\n",
-            argv[0]);
+    char *batchDirString = NULL;
+    bool usageError = false;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg += 2) {
+        if (arg + 1 == argc) {
+            usageError = true;
+        }
+        else if (strcmp(argv[arg], "--cache") == 0) {
+            cacheDirString = argv[arg + 1];
+        }
+        else if (strcmp(argv[arg], "--batch") == 0) {
+            batchDirString = argv[arg + 1];
+        }
+        else {
+            usageError = true;
+        }
+    }
+    if (usageError || arg != (batchDirString != NULL ? argc : argc - 2)) {
+        printf("error: usage: %s [--cache <directory>] <assembly-code-file> <machine-code-file>\n"
+            "       %s [--cache <directory>] --batch <directory>\n", argv[0], argv[0]);
         exit(1);
     }
+    if (cacheDirString != NULL && mkdir(cacheDirString, 0777) != 0 && errno != EEXIST) {
+        printf("warning: can't create cache directory %s, not caching\n", cacheDirString);
+        cacheDirString = NULL;
+    }
 
-    inFileString = argv[1];
-    outFileString = argv[2];
+    if (batchDirString != NULL) {
+        return assembleDirectory(batchDirString);
+    }
+    bool hit = false;
+    return assembleCached(argv[arg], argv[arg + 1], false, &hit);
+}
+
+// Assembles one file into an object file. Returns 0; errors exit the process.
+int
+assembleFile(char *inFileString, char *outFileString)
+{
+    FILE *inFilePtr, *outFilePtr;
 
     inFilePtr = fopen(inFileString, "r");
     if (inFilePtr == NULL) {
         printf("error in opening %s\n", inFileString);
         exit(1);
     }
-    // Check for blank lines in the middle of the code.
-    checkForBlankLinesInCode(inFilePtr);
-    
-    outFilePtr = fopen(outFileString, "w");
-    if (outFilePtr == NULL) {
-        printf("error in opening %s\n", outFileString);
-        exit(1);
-    }
-
-    /* here is an example for how to use readAndParse to read a line from
-        inFilePtr */
-    if (! readAndParse(inFilePtr, label, opcode, arg0, arg1, arg2) ) {
-        /* reached end of file */
-    }
-
-    /* after doing a readAndParse, you may want to do the following to test the
-        opcode */
-    if (!strcmp(opcode, "add")) {
-        /* do whatever you need to do for opcode "add" */
-    }
+    size_t sourceSize;
+    char *source = mapSource(inFileString, &sourceSize);
 
-    /* this is how to rewind the file ptr so that you start reading from the
-        beginning of the file */
-    rewind(inFilePtr);
-
-    // First Pass: Collect labels and their addresses
+    // Single pass: collect labels and their addresses, and encode every line whose operands are all numbers.
+    // Lines that use a label, or would print a diagnostic, are kept as fixups and finished once every
+    // label is known, so their diagnostics come out in line order as before.
     int dataAddressNum = -1;
     int textAddressNum = 0;
-    while (readAndParse(inFilePtr, label, opcode, arg0, arg1, arg2)) {
+    char *lineEnd;
+    for (char *line = source; (lineEnd = nextLine(line, source + sourceSize, textAddressNum)) != NULL;
+        line = lineEnd + 1) {
+        char *label, *opcode, *arg0, *arg1, *arg2;
+        tokenizeLine(line, lineEnd, &label, &opcode, &arg0, &arg1, &arg2);
         if (strcmp(opcode, ".fill") == 0) {
             dataAddressNum++;
         }
@@ -126,111 +205,33 @@ main(int argc, char **argv)
             bool foundLabel = false;
             bool addReloc = false;
 
-            //Checks for labels at the end of the line (arg2)
-            if (strlen(arg2) > 0 && !isNumber(arg2)) {
-                for (int i = 0; i < symbolTableSize; ++i) {
-                    if (strcmp(symbolTable[i].label, arg2) == 0) {
-                        foundLabel = true;
-                        //If the symbol is undefined and still doing things then keep adding those lines to relocation table
-                        if (symbolTable[i].type == 'U') {
-                            addReloc = true;
-                        }
-                    }
-                }
-                //Add to symbol table as undefined and to relocation table if the label wasn't found
-                if (!foundLabel) {
-                    undefinedResult = addLabelToSymbolTable(arg2, 0, 'U', isGlobalLabel(arg2));
-                    if (!isNumber(arg2)) {
-                        addEntryToRelocationTable(arg2, textAddressNum, opcode);
-                    }
-                }
-                else if(foundLabel && addReloc) {
-                    addEntryToRelocationTable(arg2, textAddressNum, opcode);
-                }
-                else {
-                    foundLabel = false;
-                }
-            }
+            //Checks for labels at the end of the line (arg2), then in arg0 and arg1
+            recordOperandLabel(arg2, opcode, textAddressNum, &foundLabel, &addReloc, &undefinedResult);
+            recordOperandLabel(arg0, opcode, textAddressNum, &foundLabel, &addReloc, &undefinedResult);
+            recordOperandLabel(arg1, opcode, textAddressNum, &foundLabel, &addReloc, &undefinedResult);
 
-            //Checks for labels in arg0
-            if (strlen(arg0) > 0 && !isNumber(arg0)) {
-                for (int i = 0; i < symbolTableSize; ++i) {
-                    if (strcmp(symbolTable[i].label, arg0) == 0) {
-                        foundLabel = true;
-                        //If the symbol is undefined and still doing things then keep adding those lines to relocation table
-                        if (symbolTable[i].type == 'U') {
-                            addReloc = true;
-                        }
-                    }
-                }
-                //Add to symbol table as undefined and to relocation table if the label wasn't found
-                if (!foundLabel) {
-                    undefinedResult = addLabelToSymbolTable(arg0, 0, 'U', isGlobalLabel(arg0));
-                    if (!isNumber(arg0)) {
-                        addEntryToRelocationTable(arg0, textAddressNum, opcode);
-                    }
-                }
-                else if(foundLabel && addReloc) {
-                    addEntryToRelocationTable(arg0, textAddressNum, opcode);
-                }
-                else {
-                    foundLabel = false;
-                }
-            }
-
-            //Checks for the labels in arg1 slot
-            if (strlen(arg1) > 0 && !isNumber(arg1)) {
-                for (int i = 0; i < symbolTableSize; ++i) {
-                    if (strcmp(symbolTable[i].label, arg1) == 0) {
-                        foundLabel = true;
-                        //If the symbol is undefined and still doing things then keep adding those lines to relocation table
-                        if (symbolTable[i].type == 'U') {
-                            addReloc = true;
-                        }
-                    }
-                }
-                //Add to symbol table as undefined and to relocation table if the label wasn't found
-                if (!foundLabel) {
-                    undefinedResult = addLabelToSymbolTable(arg1, 0, 'U', isGlobalLabel(arg1));
-                    if (!isNumber(arg1)) {
-                        addEntryToRelocationTable(arg1, textAddressNum, opcode);
-                    }
-                }
-                else if(foundLabel && addReloc) {
-                    addEntryToRelocationTable(arg1, textAddressNum, opcode);
-                }
-                else {
-                    foundLabel = false;
-                }
-            }
-            
             //Checks the labels at the start of a line
             if (strlen(label) > 0) {
-                for (int i = 0; i < symbolTableSize; ++i) {
-                    if (strcmp(symbolTable[i].label, label) == 0) {
-                        foundLabel = true;
-                        //If its got .fill then its a directive
-                        if (strcmp(opcode, ".fill") == 0) {
-                            symbolTable[i].type = 'D';
-                            symbolTable[i].offset = dataSectionSize;
-                            dataSectionSize++;
-                        }
-                        else {
-                            symbolTable[i].type = 'T';
-                            symbolTable[i].offset = textSectionSize;
-                            textSectionSize++;
-                        }
+                int i = findSymbol(label);
+                if (i >= 0) {
+                    foundLabel = true;
+                    //If its got .fill then its a directive
+                    if (strcmp(opcode, ".fill") == 0) {
+                        symbolTable[i].type = 'D';
+                        symbolTable[i].address = dataAddressNum;
+                    }
+                    else {
+                        symbolTable[i].type = 'T';
+                        symbolTable[i].address = textAddressNum;
                     }
                 }
                 //Label is not already in the symbol table
                 if (!foundLabel) {
                     if (strcmp(opcode, ".fill") == 0) {
                         result = addLabelToSymbolTable(label, dataAddressNum, 'D', isGlobalLabel(label));
-                        dataSectionSize++;
                     }
                     else {
                         result = addLabelToSymbolTable(label, textAddressNum, 'T', isGlobalLabel(label));
-                        textSectionSize++;
                     }
                 }
                 else {
@@ -241,55 +242,69 @@ main(int argc, char **argv)
             if (undefinedResult < 0) {
                 // Error handling based on the returned error code
                 if (undefinedResult == -1) {
-                    fprintf(stderr, "Assembly halted: Symbol table capacity exceeded.\n");
+                    fprintf(stderr, "Assembly halted: Out of memory for the symbol table.\n");
                 } else if (undefinedResult == -2) {
                     fprintf(stderr, "Assembly halted: Duplicate label '%s'.\n", label);
                 }
                 // Close files and clean up resources before exiting
                 fclose(inFilePtr);
-                fclose(outFilePtr);
                 exit(1);
             }
             if (result < 0) {
                 // Error handling based on the returned error code
                 if (result == -1) {
-                    fprintf(stderr, "Assembly halted: Symbol table capacity exceeded.\n");
+                    fprintf(stderr, "Assembly halted: Out of memory for the symbol table.\n");
                 } else if (result == -2) {
                     fprintf(stderr, "Assembly halted: Duplicate label '%s'.\n", label);
                 }
                 // Close files and clean up resources before exiting
                 fclose(inFilePtr);
-                fclose(outFilePtr);
                 exit(1);
             }
         }
+
+        if (isNumberOrEmpty(arg0) && isNumberOrEmpty(arg1) && isNumberOrEmpty(arg2)
+            && encodesCleanly(opcode, arg0, arg1, arg2)) {
+            if (strcmp(opcode, ".fill") == 0) {
+                int index = addWordToSection(&dataSection, &dataSectionSize, &dataSectionCapacity);
+                dataSection[index] = atoi(arg0);
+            } else {
+                int index = addWordToSection(&textSection, &textSectionSize, &textSectionCapacity);
+                textSection[index] = encodeInstructionWithLabelResolution(opcode, arg0, arg1, arg2, textAddressNum);
+            }
+        }
+        else if (strcmp(opcode, ".fill") == 0) {
+            addFixup(opcode, arg0, arg1, arg2, textAddressNum, dataAddressNum,
+                addWordToSection(&dataSection, &dataSectionSize, &dataSectionCapacity));
+        }
+        else {
+            addFixup(opcode, arg0, arg1, arg2, textAddressNum, dataAddressNum,
+                addWordToSection(&textSection, &textSectionSize, &textSectionCapacity));
+        }
         textAddressNum++;
     }
 
-    // Prepare for second pass
-    rewind(inFilePtr);
-    dataSectionSize = 0;
-    textSectionSize = 0;
-    textAddressNum = 0;
-    dataAddressNum = -1;
+    outFilePtr = fopen(outFileString, "w");
+    if (outFilePtr == NULL) {
+        printf("error in opening %s\n", outFileString);
+        exit(1);
+    }
 
-    // Second Pass: Encode instructions and resolve labels
-    while (readAndParse(inFilePtr, label, opcode, arg0, arg1, arg2)) {
-        if (strcmp(opcode, ".fill") == 0) {
-            dataAddressNum++;
-        }
+    // Finish the fixups now that every label is known
+    for (int fixupIndex = 0; fixupIndex < fixupTableSize; ++fixupIndex) {
+        Fixup *fixup = &fixupTable[fixupIndex];
+        char *opcode = fixup->opcode, *arg0 = fixup->arg0, *arg1 = fixup->arg1, *arg2 = fixup->arg2;
         //Find the label in the table and see if it is undefined and local
-        for (int i = 0; i < symbolTableSize; ++i) {
-            if (strcmp(symbolTable[i].label, arg2) == 0 && symbolTable[i].type == 'U' && !symbolTable[i].isGlobal) {
-                printf("Error: Undefined label %s\n", arg2);
-                exit(1); // Exit if the label is undefined
-            }
+        int arg2Symbol = findSymbol(arg2);
+        if (arg2Symbol >= 0 && symbolTable[arg2Symbol].type == 'U' && !symbolTable[arg2Symbol].isGlobal) {
+            printf("Error: Undefined label %s\n", arg2);
+            exit(1); // Exit if the label is undefined
         }
         //Make sure beq doesn't use undefined labels
         if (strcmp(opcode, "beq") == 0) {
-            for (int i = 0; i < symbolTableSize; ++i) {
-                if ((strcmp(symbolTable[i].label, arg0) == 0 || strcmp(symbolTable[i].label, arg1) == 0 
-                    || strcmp(symbolTable[i].label, arg2) == 0) && symbolTable[i].type == 'U') {
+            int operandSymbols[3] = {findSymbol(arg0), findSymbol(arg1), arg2Symbol};
+            for (int i = 0; i < 3; ++i) {
+                if (operandSymbols[i] >= 0 && symbolTable[operandSymbols[i]].type == 'U') {
                     printf("Error: beq using undefined symbolic address \n");
                     exit(1); // Exit if beq is using a symbolic address
                 }
@@ -299,7 +314,7 @@ main(int argc, char **argv)
         // Handle '.fill' directive specifically
         if (strcmp(opcode, ".fill") == 0) {
             int value;
-            if (isNumber(arg0)) {
+            if (isDecimal(arg0)) {
                 value = atoi(arg0); // Directly use the numeric value if arg0 is a number
             } else {
                 // If arg0 is not a number, assume it's a symbolic address and resolve it
@@ -308,29 +323,28 @@ main(int argc, char **argv)
                     printf("Error: Undefined label %s\n", arg0);
                     exit(1); // Exit if the label is undefined
                 }
-                value = labelAddress; // Use the resolved label address
-                if (!isNumber(arg0)) {
-                    addEntryToRelocationTable(arg0, dataAddressNum, opcode);
-                }
+                value = symbolAddress(findSymbol(arg0)); // The resolved label address
+                addEntryToRelocationTable(arg0, fixup->dataAddress, opcode);
             }
-            dataSection[dataSectionSize++] = value; // Store the resolved value in the data section
+            dataSection[fixup->sectionIndex] = value; // Store the resolved value in the data section
         } else {
             // For other instructions, encode them normally
-            int encodedInstruction = encodeInstructionWithLabelResolution(opcode, arg0, arg1, arg2, textAddressNum);
-            textSection[textSectionSize++] = encodedInstruction;
+            textSection[fixup->sectionIndex] = encodeInstructionWithLabelResolution(opcode, arg0, arg1, arg2,
+                fixup->textAddress);
         }
-        textAddressNum++;
     }
 
-    rewind(inFilePtr);
-
     // Now output the object file with the proper format
     fprintf(outFilePtr, "%d %d %d %d\n", textSectionSize, dataSectionSize, symbolTablePrintSize, relocationTableSize); // Header
-    /* this will print the correct machine code for the file */
-    print_inst_machine_code(inFilePtr, outFilePtr);
+    for (int i = 0; i < textSectionSize; i++) {
+        fprintf(outFilePtr, "%d\n", textSection[i]); // Text
+    }
+    for (int i = 0; i < dataSectionSize; i++) {
+        fprintf(outFilePtr, "%d\n", dataSection[i]); // Data
+    }
     for (int i = 0; i < symbolTableSize; i++) {
         if (symbolTable[i].isGlobal) {
-            fprintf(outFilePtr, "%s %c %d\n", symbolTable[i].label, symbolTable[i].type, symbolTable[i].offset); // Symbol Table
+            fprintf(outFilePtr, "%s %c %d\n", symbolTable[i].label, symbolTable[i].type, symbolTable[i].address); // Symbol Table
         }
     }
     for (int i = 0; i < relocationTableSize; i++) {
@@ -342,6 +356,111 @@ main(int argc, char **argv)
     return 0;
 }
 
+// Writes outFileString from the --cache directory if it holds the object of inFileString's bytes, and sets
+// *hit, otherwise assembles it and adds the object to the cache. With isolate set, assembly runs in a child
+// process so that its errors, which exit, and its tables don't outlive the file. Returns 0 if outFileString
+// was written.
+int
+assembleCached(char *inFileString, char *outFileString, bool isolate, bool *hit)
+{
+    char cacheString[MAXLINELENGTH + 32];
+    uint64_t key = hashBytes(HASH_START, CACHE_VERSION, strlen(CACHE_VERSION));
+    bool cached = cacheDirString != NULL && hashFile(inFileString, &key)
+        && snprintf(cacheString, sizeof(cacheString), "%s/%016llx.obj", cacheDirString,
+            (unsigned long long)key) < (int)sizeof(cacheString);
+    if (cached && copyFile(cacheString, outFileString)) {
+        *hit = true;
+        return 0;
+    }
+
+    if (isolate) {
+        // Don't let the child flush a copy of anything still buffered here
+        fflush(NULL);
+    }
+    pid_t child = isolate ? fork() : 0;
+    if (child < 0) {
+        printf("error: can't start a process to assemble %s\n", inFileString);
+        return 1;
+    }
+    if (child == 0) {
+        assembleFile(inFileString, outFileString);
+        if (cached) {
+            storeInCache(outFileString, cacheString);
+        }
+        if (isolate) {
+            exit(0);
+        }
+        return 0;
+    }
+    int status;
+    if (waitpid(child, &status, 0) != child || !WIFEXITED(status)) {
+        return 1;
+    }
+    return WEXITSTATUS(status);
+}
+
+// Assembles every .as, .s and .lc2k file in dirString into an object file next to it, in name order, and
+// prints how many came from the cache. Returns 1 if any of them failed.
+int
+assembleDirectory(char *dirString)
+{
+    DIR *dir = opendir(dirString);
+    if (dir == NULL) {
+        printf("error in opening %s\n", dirString);
+        exit(1);
+    }
+    char **names = NULL;
+    int numNames = 0;
+    int namesCapacity = 0;
+    for (struct dirent *entry; (entry = readdir(dir)) != NULL;) {
+        if (!isSourceName(entry->d_name)) {
+            continue;
+        }
+        if (numNames == namesCapacity) {
+            namesCapacity = namesCapacity ? 2 * namesCapacity : 64;
+            names = realloc(names, namesCapacity * sizeof(char *));
+        }
+        if (names == NULL || (names[numNames] = strdup(entry->d_name)) == NULL) {
+            fprintf(stderr, "Assembly halted: Out of memory for the file list.\n");
+            exit(1);
+        }
+        numNames++;
+    }
+    closedir(dir);
+    qsort(names, numNames, sizeof(char *), compareNames);
+
+    int failed = 0;
+    int fromCache = 0;
+    for (int i = 0; i < numNames; ++i) {
+        size_t baseLength = strrchr(names[i], '.') - names[i];
+        char inFileString[MAXLINELENGTH], outFileString[MAXLINELENGTH];
+        if (snprintf(inFileString, sizeof(inFileString), "%s/%s", dirString, names[i])
+                >= (int)sizeof(inFileString)
+            || snprintf(outFileString, sizeof(outFileString), "%s/%.*s.obj", dirString, (int)baseLength,
+                names[i]) >= (int)sizeof(outFileString)) {
+            printf("error: path of %s is too long\n", names[i]);
+            failed++;
+            continue;
+        }
+        bool hit = false;
+        if (assembleCached(inFileString, outFileString, true, &hit) != 0) {
+            printf("error: %s did not assemble\n", inFileString);
+            failed++;
+        }
+        fromCache += hit;
+    }
+    for (int i = 0; i < numNames; ++i) {
+        free(names[i]);
+    }
+    free(names);
+    printf("%d of %d files assembled", numNames - failed, numNames);
+    if (cacheDirString != NULL) {
+        printf(", %d from the cache", fromCache);
+    }
+    printf("\n");
+    return failed ? 1 : 0;
+}
+
 /*
 * NOTE: The code defined below is not to be modifed as it is implemented correctly.
 */
@@ -467,14 +586,17 @@ int encodeInstructionWithLabelResolution(char* opcode, char* arg0, char* arg1, c
     else if (strcmp(opcode, "jalr") == 0) op = 5;
     else if (strcmp(opcode, "halt") == 0) op = 6;
     else if (strcmp(opcode, "noop") == 0) op = 7;
-    else return -1; // Invalid opcode
+    else {
+        printf("Error: Unrecognized opcode '%s'.\n", opcode);
+        exit(1);
+    }
 
     if (!(strcmp(opcode, "halt") == 0 || strcmp(opcode, "noop") == 0)) {
         // Validate registers for instructions that require them
         if (!isValidRegister(arg0) || (op != 5 && !isValidRegister(arg1)) ||
             (op <= 1 && !isValidRegister(arg2))) { // For R-type instructions and others needing registers except jalr which uses only arg0 and arg1
             printf("Error: Invalid register number in instruction '%s %s %s %s'.\n", opcode, arg0, arg1, arg2);
-            return -1; // Indicate an error in encoding due to invalid register number
+            exit(1);
         }
     }
 
@@ -487,11 +609,14 @@ int encodeInstructionWithLabelResolution(char* opcode, char* arg0, char* arg1, c
         if (isNumber(arg2)) {
             offset = atoi(arg2);
         } else {
-            offset = findLabelAddressSymbols(arg2) - currentAddress;
+            // The field the object gets: lw and sw hold the label's address and beq the distance from pc + 1
+            int address = symbolAddress(findSymbol(arg2));
+            offset = op == 4 ? address - currentAddress - 1 : address;
         }
         machineCode = (op << 22) | (regA << 19) | (regB << 16) | (offset & 0xFFFF);
         if (offset < -32768 || offset > 32767) {
-            printf("Error: Offset %d out of range for 16-bit signed integer.\n", offset);
+            printf("Error: Offset %d of '%s %s %s %s' at address %d does not fit in the 16-bit offset field "
+                "(-32768 to 32767).\n", offset, opcode, arg0, arg1, arg2, currentAddress);
             exit(1);
         }
     } else if (op == 5) { // J-type: jalr
@@ -504,21 +629,26 @@ int encodeInstructionWithLabelResolution(char* opcode, char* arg0, char* arg1, c
     return machineCode;
 }
 
-int findLabelAddressSymbols(char *label) {
-    for (int i = 0; i < symbolTableSize; i++) {
-        if (strcmp(symbolTable[i].label, label) == 0) {
-            return symbolTable[i].offset;
-        }
+// The object's address for symbol symbolIndex, with data after all the text. An undefined global, or a
+// missing symbol, is left at 0 for the linker to fill.
+int symbolAddress(int symbolIndex) {
+    if (symbolIndex < 0 || symbolTable[symbolIndex].type == 'U') {
+        return 0;
     }
-    return -1; // Indicate unresolved label
+    SymbolTableEntry *symbol = &symbolTable[symbolIndex];
+    return symbol->type == 'D' ? textSectionSize + symbol->address : symbol->address;
+}
+
+int findLabelAddressSymbols(char *label) {
+    int i = findSymbol(label);
+    return i >= 0 ? symbolTable[i].address : -1; // -1 indicates unresolved label
 }
 int findLabelAddressRelocate(char *label) {
-    for (int i = 0; i < relocationTableSize; i++) {
-        if (strcmp(relocationTable[i].label, label) == 0) {
-            return relocationTable[i].offset;
-        }
+    InternedString *string = findInterned(label);
+    if (string == NULL || string->firstRelocation < 0) {
+        return -1; // Indicate unresolved label
     }
-    return -1; // Indicate unresolved label
+    return relocationTable[string->firstRelocation].offset;
 }
 
 // Function to determine if a label is global
@@ -527,21 +657,35 @@ bool isGlobalLabel(char* label) {
 }
 
 // When adding a label to the symbol table:
-int addLabelToSymbolTable(char* label, int offset, char type, bool isGlobal) {
+int addLabelToSymbolTable(char* label, int address, char type, bool isGlobal) {
+    InternedString *name = intern(label);
+    if (name == NULL) {
+        return -1; // Indicate error due to running out of memory
+    }
     // Check for duplicate labels
-    for (int i = 0; i < symbolTableSize; i++) {
-        //!isNumber(label) is just making sure that it didn't fuck up somehow
-        if (strcmp(symbolTable[i].label, label) == 0 && !isNumber(label)) {
-            printf("Error: Duplicate label '%s' found.\n", label);
-            return -2; // Indicate error due to duplicate label
-        }
+    //!isNumber(label) is just making sure that it didn't fuck up somehow
+    if (name->symbolIndex >= 0 && !isNumber(label)) {
+        printf("Error: Duplicate label '%s' found.\n", label);
+        return -2; // Indicate error due to duplicate label
     }
 
     // Add label to symbol table
-    strcpy(symbolTable[symbolTableSize].label, label);
-    symbolTable[symbolTableSize].offset = offset;
+    if (symbolTableSize == symbolTableCapacity) {
+        int capacity = symbolTableCapacity ? 2 * symbolTableCapacity : 64;
+        SymbolTableEntry *table = realloc(symbolTable, capacity * sizeof(SymbolTableEntry));
+        if (table == NULL) {
+            return -1;
+        }
+        symbolTable = table;
+        symbolTableCapacity = capacity;
+    }
+    symbolTable[symbolTableSize].label = name->text;
+    symbolTable[symbolTableSize].address = address;
     symbolTable[symbolTableSize].type = type;
     symbolTable[symbolTableSize].isGlobal = isGlobal;
+    if (name->symbolIndex < 0) {
+        name->symbolIndex = symbolTableSize;
+    }
     symbolTableSize++;
     if (isGlobal) {
         symbolTablePrintSize++;
@@ -562,8 +706,408 @@ void addEntryToRelocationTable(const char* label, int currentAddress, const char
     if (strcmp(opcode, "beq") == 0) {
         return;
     }
+    InternedString *name = intern(label);
+    InternedString *opcodeName = intern(opcode);
+    if (relocationTableSize == relocationTableCapacity) {
+        relocationTableCapacity = relocationTableCapacity ? 2 * relocationTableCapacity : 64;
+        relocationTable = realloc(relocationTable, relocationTableCapacity * sizeof(RelocationTableEntry));
+    }
+    if (name == NULL || opcodeName == NULL || relocationTable == NULL) {
+        fprintf(stderr, "Assembly halted: Out of memory for the relocation table.\n");
+        exit(1);
+    }
     relocationTable[relocationTableSize].offset = currentAddress;
-    strcpy(relocationTable[relocationTableSize].opcode, opcode);
-    strcpy(relocationTable[relocationTableSize].label, label);
+    relocationTable[relocationTableSize].opcode = opcodeName->text;
+    relocationTable[relocationTableSize].label = name->text;
+    if (name->firstRelocation < 0) {
+        name->firstRelocation = relocationTableSize;
+    }
     relocationTableSize++;
-}
\ No newline at end of file
+}
+
+// First pass over one operand: an unknown symbolic operand is added to the symbol table as undefined, and
+// operands naming undefined symbols get relocation entries. foundLabel and addReloc carry over from the
+// line's earlier operands, and undefinedResult gets the result of any addLabelToSymbolTable call.
+void recordOperandLabel(char *arg, const char *opcode, int currentAddress, bool *foundLabel, bool *addReloc,
+    int *undefinedResult) {
+    if (strlen(arg) == 0 || isDecimal(arg)) {
+        return;
+    }
+    int i = findSymbol(arg);
+    if (i >= 0) {
+        *foundLabel = true;
+        //If the symbol is undefined and still doing things then keep adding those lines to relocation table
+        if (symbolTable[i].type == 'U') {
+            *addReloc = true;
+        }
+    }
+    //A .fill line gets its relocation entry, numbered within the data section, once every label is known
+    bool relocate = strcmp(opcode, ".fill") != 0;
+    //Add to symbol table as undefined and to relocation table if the label wasn't found
+    if (!*foundLabel) {
+        *undefinedResult = addLabelToSymbolTable(arg, 0, 'U', isGlobalLabel(arg));
+        if (relocate) {
+            addEntryToRelocationTable(arg, currentAddress, opcode);
+        }
+    }
+    else if (*addReloc) {
+        if (relocate) {
+            addEntryToRelocationTable(arg, currentAddress, opcode);
+        }
+    }
+    else {
+        *foundLabel = false;
+    }
+}
+
+// Returns memory for size bytes that stays valid until the assembler exits, or NULL if there is none
+void *arenaAlloc(size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    if (arena == NULL || arena->size - arena->used < size) {
+        size_t blockSize = size > 65536 ? size : 65536;
+        ArenaBlock *block = malloc(sizeof(ArenaBlock) + blockSize);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = arena;
+        block->used = 0;
+        block->size = blockSize;
+        arena = block;
+    }
+    void *memory = arena->data + arena->used;
+    arena->used += size;
+    return memory;
+}
+
+// FNV-1a
+uint32_t hashString(const char *text) {
+    uint32_t hash = 2166136261u;
+    for (; *text != '\0'; ++text) {
+        hash = (hash ^ (unsigned char)*text) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the interned copy of text, or NULL if it has never been interned
+InternedString *findInterned(const char *text) {
+    if (internBucketCount == 0) {
+        return NULL;
+    }
+    uint32_t hash = hashString(text);
+    for (InternedString *string = internBuckets[hash & (internBucketCount - 1)]; string != NULL;
+        string = string->next) {
+        if (string->hash == hash && strcmp(string->text, text) == 0) {
+            return string;
+        }
+    }
+    return NULL;
+}
+
+// Returns the interned copy of text, adding it if needed, or NULL if out of memory
+InternedString *intern(const char *text) {
+    InternedString *string = findInterned(text);
+    if (string != NULL) {
+        return string;
+    }
+    // Keep at most one string per bucket on average
+    if (internCount >= internBucketCount) {
+        int bucketCount = internBucketCount ? 2 * internBucketCount : 1024;
+        InternedString **buckets = calloc(bucketCount, sizeof(InternedString *));
+        if (buckets == NULL) {
+            return NULL;
+        }
+        for (int i = 0; i < internBucketCount; ++i) {
+            while (internBuckets[i] != NULL) {
+                InternedString *moved = internBuckets[i];
+                internBuckets[i] = moved->next;
+                moved->next = buckets[moved->hash & (bucketCount - 1)];
+                buckets[moved->hash & (bucketCount - 1)] = moved;
+            }
+        }
+        free(internBuckets);
+        internBuckets = buckets;
+        internBucketCount = bucketCount;
+    }
+    size_t length = strlen(text);
+    string = arenaAlloc(sizeof(InternedString) + length + 1);
+    if (string == NULL) {
+        return NULL;
+    }
+    string->hash = hashString(text);
+    string->symbolIndex = -1;
+    string->firstRelocation = -1;
+    memcpy(string->text, text, length + 1);
+    string->next = internBuckets[string->hash & (internBucketCount - 1)];
+    internBuckets[string->hash & (internBucketCount - 1)] = string;
+    internCount++;
+    return string;
+}
+
+// Returns the index of label in symbolTable, or -1 if it isn't there
+int findSymbol(const char *label) {
+    InternedString *string = findInterned(label);
+    return string != NULL ? string->symbolIndex : -1;
+}
+
+// Maps the source file into memory, writable and private so the tokenizer can end tokens in place. If the
+// file doesn't end in a newline, the copy returned has one at source[*size].
+char *mapSource(char *fileString, size_t *size) {
+    int fd = open(fileString, O_RDONLY);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) != 0) {
+        printf("error in opening %s\n", fileString);
+        exit(1);
+    }
+    *size = fileStat.st_size;
+    char *source = *size > 0 ? mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (*size > 0 && source == MAP_FAILED) {
+        printf("error in opening %s\n", fileString);
+        exit(1);
+    }
+    if (*size == 0 || source[*size - 1] != '\n') {
+        char *copy = malloc(*size + 1);
+        if (copy == NULL) {
+            fprintf(stderr, "Assembly halted: Out of memory for the source.\n");
+            exit(1);
+        }
+        if (*size > 0) {
+            memcpy(copy, source, *size);
+            munmap(source, *size);
+        }
+        copy[*size] = '\n';
+        source = copy;
+    }
+    return source;
+}
+
+// Returns non-zero if the length characters at line are all whitespace, as lineIsBlank counts it.
+int spanIsBlank(const char *line, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (line[i] != '\t' && line[i] != '\n' && line[i] != '\r' && line[i] != ' ') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Returns the newline ending the line that starts at line, or NULL once the code is over. Exits just
+// like checkForBlankLinesInCode if a line is too long or a blank line comes before the end of the code;
+// address is the line's number.
+char *nextLine(char *line, char *end, int address) {
+    int blankAddress = -1;
+    for (; line < end; ++address) {
+        char *lineEnd = memchr(line, '\n', end - line);
+        size_t length = lineEnd != NULL ? (size_t)(lineEnd - line) + 1 : (size_t)(end - line);
+        if (lineEnd == NULL) {
+            lineEnd = end; // The newline mapSource added
+        }
+        // Check for line too long
+        if (length >= MAXLINELENGTH - 1) {
+            printf("error: line too long\n");
+            exit(1);
+        }
+        // Check for blank line.
+        if (spanIsBlank(line, length)) {
+            if (blankAddress < 0) {
+                blankAddress = address;
+            }
+        } else if (blankAddress >= 0) {
+            printf("Invalid Assembly: Empty line at address %d\n", blankAddress);
+            exit(2);
+        } else {
+            return lineEnd;
+        }
+        line = lineEnd + 1;
+    }
+    return NULL;
+}
+
+/*
+ * Splits the line from line to its newline at lineEnd into the fields readAndParse would return,
+ * without copying: each field is ended in place and the ones that are missing point to "".
+ */
+void tokenizeLine(char *line, char *lineEnd, char **label, char **opcode, char **arg0, char **arg1,
+    char **arg2) {
+    static char empty[1] = "";
+    char **fields[4] = {opcode, arg0, arg1, arg2};
+    char *ptr = line;
+
+    *label = *opcode = *arg0 = *arg1 = *arg2 = empty;
+    // is there a label?
+    while (ptr < lineEnd && *ptr != '\t' && *ptr != ' ') {
+        ++ptr;
+    }
+    if (ptr > line) {
+        *label = line;
+    }
+    // The rest of the line is fields separated by whitespace
+    for (int field = 0; ptr < lineEnd && field < 4; ++field) {
+        *ptr++ = '\0'; // Ends the previous field
+        while (ptr < lineEnd && (*ptr == '\t' || *ptr == '\r' || *ptr == ' ')) {
+            ++ptr;
+        }
+        if (ptr == lineEnd) {
+            break;
+        }
+        *fields[field] = ptr;
+        while (ptr < lineEnd && *ptr != '\t' && *ptr != '\r' && *ptr != ' ') {
+            ++ptr;
+        }
+    }
+    *ptr = '\0';
+}
+
+// Returns non-zero if string is a decimal integer, as isNumber decides it, without the cost of sscanf
+int isDecimal(char *string) {
+    while (*string == ' ' || (*string >= '\t' && *string <= '\r')) {
+        string++;
+    }
+    if (*string == '+' || *string == '-') {
+        string++;
+    }
+    if (*string < '0' || *string > '9') {
+        return 0;
+    }
+    while (*string >= '0' && *string <= '9') {
+        string++;
+    }
+    return *string == '\0';
+}
+
+// Returns non-zero if token is empty or a number
+int isNumberOrEmpty(char *token) {
+    return *token == '\0' || isDecimal(token);
+}
+
+// Returns true if the line can be encoded now: it needs no label and encoding it prints nothing.
+// The operands must all pass isNumberOrEmpty.
+bool encodesCleanly(char *opcode, char *arg0, char *arg1, char *arg2) {
+    if (strcmp(opcode, ".fill") == 0) {
+        return *arg0 != '\0';
+    }
+    if (strcmp(opcode, "add") == 0 || strcmp(opcode, "nor") == 0) {
+        return isValidRegister(arg0) && isValidRegister(arg1) && isValidRegister(arg2);
+    }
+    if (strcmp(opcode, "lw") == 0 || strcmp(opcode, "sw") == 0 || strcmp(opcode, "beq") == 0) {
+        int offset = atoi(arg2);
+        return isValidRegister(arg0) && isValidRegister(arg1) && *arg2 != '\0'
+            && offset >= -32768 && offset <= 32767;
+    }
+    if (strcmp(opcode, "jalr") == 0) {
+        return isValidRegister(arg0) && isValidRegister(arg1);
+    }
+    return strcmp(opcode, "halt") == 0 || strcmp(opcode, "noop") == 0;
+}
+
+// Function to add a line to the fixup table
+void addFixup(char *opcode, char *arg0, char *arg1, char *arg2, int textAddress, int dataAddress,
+    int sectionIndex) {
+    if (fixupTableSize == fixupTableCapacity) {
+        fixupTableCapacity = fixupTableCapacity ? 2 * fixupTableCapacity : 64;
+        fixupTable = realloc(fixupTable, fixupTableCapacity * sizeof(Fixup));
+        if (fixupTable == NULL) {
+            fprintf(stderr, "Assembly halted: Out of memory for the fixup table.\n");
+            exit(1);
+        }
+    }
+    Fixup *fixup = &fixupTable[fixupTableSize++];
+    fixup->opcode = opcode;
+    fixup->arg0 = arg0;
+    fixup->arg1 = arg1;
+    fixup->arg2 = arg2;
+    fixup->textAddress = textAddress;
+    fixup->dataAddress = dataAddress;
+    fixup->sectionIndex = sectionIndex;
+}
+
+// Adds a word to the end of a section, growing it as needed, and returns the word's index. Exits if the
+// program no longer fits in memory.
+int addWordToSection(int **section, int *size, int *capacity) {
+    if (textSectionSize + dataSectionSize >= MAXWORDS) {
+        printf("Error: Program has more than %d words of text and data.\n", MAXWORDS);
+        exit(1);
+    }
+    if (*size == *capacity) {
+        *capacity = *capacity ? 2 * *capacity : 1024;
+        *section = realloc(*section, *capacity * sizeof(int));
+        if (*section == NULL) {
+            fprintf(stderr, "Assembly halted: Out of memory for the sections.\n");
+            exit(1);
+        }
+    }
+    return (*size)++;
+}
+
+// Returns true if name ends in one of the extensions the Makefile assembles: .as, .s or .lc2k
+bool isSourceName(const char *name) {
+    const char *extension = strrchr(name, '.');
+    return extension != NULL && extension != name && (strcmp(extension, ".as") == 0
+        || strcmp(extension, ".s") == 0 || strcmp(extension, ".lc2k") == 0);
+}
+
+int compareNames(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Folds size bytes into a 64-bit FNV-1a hash
+uint64_t hashBytes(uint64_t hash, const void *bytes, size_t size) {
+    const unsigned char *byte = bytes;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ byte[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Folds the length and bytes of a file into *hash, returns false if it can't be read
+bool hashFile(const char *fileString, uint64_t *hash) {
+    int fd = open(fileString, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    static unsigned char buffer[1 << 16];
+    uint64_t fileHash = *hash;
+    uint64_t length = 0;
+    ssize_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) > 0) {
+        fileHash = hashBytes(fileHash, buffer, count);
+        length += count;
+    }
+    close(fd);
+    if (count < 0) {
+        return false;
+    }
+    *hash = hashBytes(fileHash, &length, sizeof(length));
+    return true;
+}
+
+// Copies a file, returns false if it couldn't. toString isn't touched unless fromString opens.
+bool copyFile(const char *fromString, const char *toString) {
+    int from = open(fromString, O_RDONLY);
+    if (from < 0) {
+        return false;
+    }
+    int to = open(toString, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (to < 0) {
+        close(from);
+        return false;
+    }
+    static char buffer[1 << 16];
+    bool copied = true;
+    ssize_t count;
+    while (copied && (count = read(from, buffer, sizeof(buffer))) != 0) {
+        copied = count > 0 && write(to, buffer, count) == count;
+    }
+    close(from);
+    return close(to) == 0 && copied;
+}
+
+// Adds an object to the cache under a private name, then renames it into place, so another assembler
+// reading the cache never sees part of an object. A cache that can't be written is skipped.
+void storeInCache(const char *fileString, const char *cacheString) {
+    char tempString[MAXLINELENGTH + 64];
+    snprintf(tempString, sizeof(tempString), "%s.%ld", cacheString, (long)getpid());
+    if (!copyFile(fileString, tempString) || rename(tempString, cacheString) != 0) {
+        unlink(tempString);
+    }
+}
@@ -0,0 +1,25 @@
+	lw	0	1	one
+	lw	0	2	len
+rep	add	0	0	3
+	add	0	0	4
+	add	0	0	5
+loop	lw	3	6	0
+	add	4	6	4
+	add	5	4	5
+	add	3	1	3
+	beq	3	2	fin
+	beq	0	0	loop
+fin	nor	4	5	6
+	sw	0	6	sum
+	lw	0	7	reps
+	lw	0	6	negOne
+	add	7	6	7
+	sw	0	7	reps
+	beq	0	7	done
+	beq	0	0	rep
+done	halt
+one	.fill	1
+negOne	.fill	-1
+len	.fill	1024
+reps	.fill	600
+sum	.fill	0
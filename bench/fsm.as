@@ -0,0 +1,49 @@
+	lw	0	1	one
+	lw	0	2	two
+	add	0	0	3
+	lw	0	4	seed
+step	add	4	4	5
+	lw	0	7	notBit
+	add	5	5	6
+	add	6	4	4
+	add	4	1	4
+	noop
+	nor	4	4	6
+	nor	6	7	6
+	beq	3	0	s0
+	beq	3	1	s1
+	beq	3	2	s2
+	beq	6	0	back3
+	add	0	0	3
+	beq	0	0	count
+back3	add	2	0	3
+	beq	0	0	count
+s0	beq	6	0	count
+	add	1	0	3
+	beq	0	0	count
+s1	beq	6	0	reset
+	add	2	0	3
+	beq	0	0	count
+reset	add	0	0	3
+	beq	0	0	count
+s2	beq	6	0	s2zero
+	add	2	1	3
+	lw	0	7	hits
+	add	7	1	7
+	sw	0	7	hits
+	beq	0	0	count
+s2zero	add	1	0	3
+count	lw	0	7	steps
+	lw	0	6	negOne
+	add	7	6	7
+	sw	0	7	steps
+	beq	0	7	done
+	beq	0	0	step
+done	halt
+one	.fill	1
+two	.fill	2
+negOne	.fill	-1
+notBit	.fill	-17
+seed	.fill	12345
+steps	.fill	300000
+hits	.fill	0
@@ -0,0 +1,33 @@
+	lw	0	1	posOne
+outer	lw	0	2	a
+	lw	0	3	b
+loop	beq	2	3	end
+	nor	2	2	4
+	add	4	1	4
+	add	4	3	5
+	lw	0	6	mask
+	nor	5	5	5
+	nor	6	6	6
+	nor	5	6	6
+	beq	0	6	less
+	nor	3	3	4
+	add	4	1	4
+	add	2	4	2
+	beq	0	0	loop
+less	add	3	4	3
+	beq	0	0	loop
+end	sw	0	2	result
+	lw	0	7	reps
+	lw	0	4	negOne
+	add	7	4	7
+	sw	0	7	reps
+	beq	0	7	done
+	beq	0	0	outer
+done	halt
+posOne	.fill	1
+negOne	.fill	-1
+mask	.fill	-32768
+a	.fill	30001
+b	.fill	7
+reps	.fill	40
+result	.fill	1
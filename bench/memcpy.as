@@ -0,0 +1,19 @@
+	lw	0	1	one
+	lw	0	2	len
+rep	add	0	0	3
+loop	lw	3	4	0
+	sw	3	4	4096
+	add	3	1	3
+	beq	3	2	next
+	beq	0	0	loop
+next	lw	0	7	reps
+	lw	0	6	negOne
+	add	7	6	7
+	sw	0	7	reps
+	beq	0	7	done
+	beq	0	0	rep
+done	halt
+one	.fill	1
+negOne	.fill	-1
+len	.fill	1024
+reps	.fill	500
@@ -0,0 +1,46 @@
+	lw	0	1	one
+rep	lw	0	2	n
+	add	0	0	3
+init	sw	3	2	arr
+	add	3	1	3
+	lw	0	6	negOne
+	add	2	6	2
+	beq	0	2	initd
+	beq	0	0	init
+initd	lw	0	2	n
+	lw	0	6	negOne
+	add	2	6	2
+outer	add	0	0	3
+inner	beq	3	2	idone
+	lw	3	4	arr
+	lw	3	5	arr1
+	nor	4	4	6
+	add	6	1	6
+	add	6	5	6
+	lw	0	7	mask
+	nor	6	6	6
+	nor	7	7	7
+	nor	6	7	6
+	beq	0	6	noswap
+	sw	3	5	arr
+	sw	3	4	arr1
+noswap	add	3	1	3
+	beq	0	0	inner
+idone	lw	0	6	negOne
+	add	2	6	2
+	beq	0	2	sdone
+	beq	0	0	outer
+sdone	lw	0	7	reps
+	lw	0	6	negOne
+	add	7	6	7
+	sw	0	7	reps
+	beq	0	7	done
+	beq	0	0	rep
+done	halt
+one	.fill	1
+negOne	.fill	-1
+mask	.fill	-32768
+n	.fill	64
+reps	.fill	150
+arr	.fill	0
+arr1	.fill	0
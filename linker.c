@@ -0,0 +1,583 @@
+/**
+ * LC-2K linker: links any number of object files written by the assembler
+ * into one machine-code file.
+ *
+ * Usage: linker [--cache <directory>] <object file>... <machine-code file>
+ *
+ * The text sections of the objects go first, in command-line order, then
+ * their data sections in the same order. Global labels (the ones starting
+ * with an upper-case letter) are resolved across objects, and Stack is the
+ * address just past the last data word.
+ *
+ * With --cache, a linked program is kept in the directory under a hash of
+ * the linker build and the bytes of every object, in order, and linking
+ * the same objects again just copies it out.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define MAXLINELENGTH 1000
+//A linked program fills at most the 65536 words of LC2K memory.
+#define MAXWORDS 65536
+#define MAXTHREADS 64
+//Linked programs in a --cache directory are keyed on the objects' bytes and this version; see TOOL_SOURCES
+//in the Makefile
+#ifndef TOOL_SOURCES
+#define TOOL_SOURCES __DATE__ " " __TIME__
+#endif
+#define CACHE_VERSION "LC-2K linker " TOOL_SOURCES
+//Cache keys are 64-bit FNV-1a hashes
+#define HASH_START 0xcbf29ce484222325ULL
+
+typedef struct {
+    char *label; // Label name, ended in place in the object file
+    char type; // 'T' for text, 'D' for data, 'U' for undefined
+    int offset; // Offset from the start of the text or data section
+} SymbolTableEntry;
+
+typedef struct {
+    int offset; // Offset from the start of the text section, or the data section for .fill
+    char *opcode; // Opcode that uses the symbol
+    char *label; // Label name
+} RelocationTableEntry;
+
+// One object file, as read and then as placed in the linked program
+typedef struct {
+    char *fileString;
+    char *contents; // The file, split into tokens in place
+    size_t size;
+    int textSize;
+    int dataSize;
+    int symbolTableSize;
+    int relocationTableSize;
+    int *text;
+    int *data;
+    SymbolTableEntry *symbolTable;
+    RelocationTableEntry *relocationTable;
+    int textStart; // Address of the first text word in the linked program
+    int dataStart; // Address of the first data word
+    char error[MAXLINELENGTH]; // Set by a worker that failed on this file
+} ObjectFile;
+
+// A defined global label
+typedef struct {
+    const char *label; // NULL for an empty slot
+    uint32_t hash;
+    int address;
+    int fileIndex;
+} GlobalEntry;
+
+// Work shared by the threads of one parallel step
+typedef struct {
+    ObjectFile *objects;
+    int numObjects;
+    int nextObject; // Next object to hand out
+    pthread_mutex_t lock;
+    void (*task)(ObjectFile *);
+} WorkList;
+
+void readObjectFile(ObjectFile *object);
+void relocateObjectFile(ObjectFile *object);
+void runInParallel(ObjectFile *objects, int numObjects, void (*task)(ObjectFile *));
+void *workerMain(void *arg);
+char *nextToken(char **cursor, char *end);
+bool parseInt(char *token, int *value);
+uint32_t hashString(const char *text);
+GlobalEntry *findGlobal(const char *label);
+bool addGlobal(const char *label, int address, int fileIndex);
+bool isGlobalLabel(const char *label);
+void writeMachineCode(FILE *outFilePtr, ObjectFile *objects, int numObjects);
+uint64_t hashBytes(uint64_t hash, const void *bytes, size_t size);
+bool hashFile(const char *fileString, uint64_t *hash);
+bool copyFile(const char *fromString, const char *toString);
+void storeInCache(const char *fileString, const char *cacheString);
+
+GlobalEntry *globalTable = NULL;
+int globalTableCapacity = 0; // Always a power of 2, at least twice the number of globals
+int stackAddress = 0;
+
+int
+main(int argc, char **argv)
+{
+    char *cacheDirString = NULL;
+    int firstObject = 1;
+    if (argc > 2 && strcmp(argv[1], "--cache") == 0) {
+        cacheDirString = argv[2];
+        firstObject = 3;
+    }
+    if (argc - firstObject < 2) {
+        printf("error: usage: %s [--cache <directory>] <object file>... <machine-code file>\n", argv[0]);
+        exit(1);
+    }
+    int numObjects = argc - firstObject - 1;
+    char *outFileString = argv[argc - 1];
+
+    // A program linked before from the same objects is copied out of the cache
+    char cacheString[MAXLINELENGTH + 32];
+    bool cached = false;
+    if (cacheDirString != NULL) {
+        if (mkdir(cacheDirString, 0777) != 0 && errno != EEXIST) {
+            printf("warning: can't create cache directory %s, not caching\n", cacheDirString);
+        }
+        else {
+            uint64_t key = hashBytes(HASH_START, CACHE_VERSION, strlen(CACHE_VERSION));
+            cached = true;
+            for (int i = firstObject; i < argc - 1 && cached; ++i) {
+                cached = hashFile(argv[i], &key);
+            }
+            cached = cached && snprintf(cacheString, sizeof(cacheString), "%s/%016llx.mc", cacheDirString,
+                (unsigned long long)key) < (int)sizeof(cacheString);
+            if (cached && copyFile(cacheString, outFileString)) {
+                return 0;
+            }
+        }
+    }
+
+    ObjectFile *objects = calloc(numObjects, sizeof(ObjectFile));
+    if (objects == NULL) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < numObjects; ++i) {
+        objects[i].fileString = argv[firstObject + i];
+    }
+
+    // Read every object file, in parallel
+    runInParallel(objects, numObjects, readObjectFile);
+    for (int i = 0; i < numObjects; ++i) {
+        if (objects[i].error[0] != '\0') {
+            printf("error: %s: %s\n", objects[i].fileString, objects[i].error);
+            exit(1);
+        }
+    }
+
+    // Place the text sections, then the data sections, in command-line order
+    long totalWords = 0;
+    int numGlobals = 0;
+    for (int i = 0; i < numObjects; ++i) {
+        objects[i].textStart = totalWords;
+        totalWords += objects[i].textSize;
+        numGlobals += objects[i].symbolTableSize;
+    }
+    for (int i = 0; i < numObjects; ++i) {
+        objects[i].dataStart = totalWords;
+        totalWords += objects[i].dataSize;
+    }
+    if (totalWords > MAXWORDS) {
+        printf("error: linked program has %ld words, more than the %d of memory\n", totalWords, MAXWORDS);
+        exit(1);
+    }
+    stackAddress = totalWords;
+
+    // Resolve every defined global label
+    globalTableCapacity = 16;
+    while (globalTableCapacity < 2 * numGlobals) {
+        globalTableCapacity *= 2;
+    }
+    globalTable = calloc(globalTableCapacity, sizeof(GlobalEntry));
+    if (globalTable == NULL) {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < numObjects; ++i) {
+        for (int j = 0; j < objects[i].symbolTableSize; ++j) {
+            SymbolTableEntry *symbol = &objects[i].symbolTable[j];
+            if (symbol->type == 'U') {
+                continue;
+            }
+            if (strcmp(symbol->label, "Stack") == 0) {
+                printf("error: %s defines Stack, which the linker reserves\n", objects[i].fileString);
+                exit(1);
+            }
+            int address = symbol->type == 'T' ? objects[i].textStart + symbol->offset
+                : objects[i].dataStart + symbol->offset;
+            if (!addGlobal(symbol->label, address, i)) {
+                printf("error: global label %s is defined in both %s and %s\n", symbol->label,
+                    objects[findGlobal(symbol->label)->fileIndex].fileString, objects[i].fileString);
+                exit(1);
+            }
+        }
+    }
+    for (int i = 0; i < numObjects; ++i) {
+        for (int j = 0; j < objects[i].symbolTableSize; ++j) {
+            SymbolTableEntry *symbol = &objects[i].symbolTable[j];
+            if (symbol->type == 'U' && strcmp(symbol->label, "Stack") != 0 && findGlobal(symbol->label) == NULL) {
+                printf("error: global label %s used in %s is not defined\n", symbol->label, objects[i].fileString);
+                exit(1);
+            }
+        }
+    }
+
+    // Apply every relocation entry; each object only patches its own sections
+    runInParallel(objects, numObjects, relocateObjectFile);
+    for (int i = 0; i < numObjects; ++i) {
+        if (objects[i].error[0] != '\0') {
+            printf("error: %s: %s\n", objects[i].fileString, objects[i].error);
+            exit(1);
+        }
+    }
+
+    FILE *outFilePtr = fopen(outFileString, "w");
+    if (outFilePtr == NULL) {
+        printf("error in opening %s\n", outFileString);
+        exit(1);
+    }
+    writeMachineCode(outFilePtr, objects, numObjects);
+    if (fclose(outFilePtr) != 0) {
+        printf("error in writing %s\n", outFileString);
+        exit(1);
+    }
+    if (cached) {
+        storeInCache(outFileString, cacheString);
+    }
+    return 0;
+}
+
+// Runs task on every object, on up to one thread per core
+void runInParallel(ObjectFile *objects, int numObjects, void (*task)(ObjectFile *)) {
+    WorkList work = {objects, numObjects, 0, PTHREAD_MUTEX_INITIALIZER, task};
+    pthread_t threads[MAXTHREADS];
+    long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads > numObjects) {
+        numThreads = numObjects;
+    }
+    if (numThreads > MAXTHREADS) {
+        numThreads = MAXTHREADS;
+    }
+    int started = 0;
+    while (started + 1 < numThreads && pthread_create(&threads[started], NULL, workerMain, &work) == 0) {
+        started++;
+    }
+    workerMain(&work);
+    for (int i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&work.lock);
+}
+
+void *workerMain(void *arg) {
+    WorkList *work = arg;
+    while (true) {
+        pthread_mutex_lock(&work->lock);
+        int i = work->nextObject++;
+        pthread_mutex_unlock(&work->lock);
+        if (i >= work->numObjects) {
+            return NULL;
+        }
+        work->task(&work->objects[i]);
+    }
+}
+
+// Returns the next whitespace-separated token before end, ended in place, or NULL if there is none
+char *nextToken(char **cursor, char *end) {
+    char *ptr = *cursor;
+    while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r')) {
+        ptr++;
+    }
+    if (ptr == end) {
+        *cursor = ptr;
+        return NULL;
+    }
+    char *token = ptr;
+    while (ptr < end && *ptr != ' ' && *ptr != '\t' && *ptr != '\n' && *ptr != '\r') {
+        ptr++;
+    }
+    if (ptr < end) {
+        *ptr++ = '\0';
+    }
+    *cursor = ptr;
+    return token;
+}
+
+// Returns true if token is a whole decimal int, stored in value
+bool parseInt(char *token, int *value) {
+    char *tokenEnd;
+    long number = strtol(token, &tokenEnd, 10);
+    if (tokenEnd == token || *tokenEnd != '\0' || number < INT32_MIN || number > INT32_MAX) {
+        return false;
+    }
+    *value = number;
+    return true;
+}
+
+/*
+ * Reads an object file: its header, text, data, symbol table and
+ * relocation table. Errors are left in object->error.
+ */
+void readObjectFile(ObjectFile *object) {
+    int fd = open(object->fileString, O_RDONLY);
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat) != 0) {
+        snprintf(object->error, sizeof(object->error), "can't open file");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    object->size = fileStat.st_size;
+    // One spare byte so the last token can be ended in place
+    object->contents = malloc(object->size + 1);
+    if (object->contents == NULL) {
+        snprintf(object->error, sizeof(object->error), "out of memory");
+        close(fd);
+        return;
+    }
+    size_t done = 0;
+    while (done < object->size) {
+        ssize_t count = read(fd, object->contents + done, object->size - done);
+        if (count <= 0) {
+            snprintf(object->error, sizeof(object->error), "can't read file");
+            close(fd);
+            return;
+        }
+        done += count;
+    }
+    close(fd);
+    char *cursor = object->contents;
+    char *end = object->contents + object->size;
+    *end = '\0';
+
+    int header[4];
+    for (int i = 0; i < 4; ++i) {
+        char *token = nextToken(&cursor, end);
+        if (token == NULL || !parseInt(token, &header[i]) || header[i] < 0 || header[i] > MAXWORDS) {
+            snprintf(object->error, sizeof(object->error), "bad header");
+            return;
+        }
+    }
+    object->textSize = header[0];
+    object->dataSize = header[1];
+    object->symbolTableSize = header[2];
+    object->relocationTableSize = header[3];
+    object->text = malloc((object->textSize + object->dataSize + 1) * sizeof(int));
+    object->data = object->text + object->textSize;
+    object->symbolTable = malloc((object->symbolTableSize + 1) * sizeof(SymbolTableEntry));
+    object->relocationTable = malloc((object->relocationTableSize + 1) * sizeof(RelocationTableEntry));
+    if (object->text == NULL || object->symbolTable == NULL || object->relocationTable == NULL) {
+        snprintf(object->error, sizeof(object->error), "out of memory");
+        return;
+    }
+
+    for (int i = 0; i < object->textSize + object->dataSize; ++i) {
+        char *token = nextToken(&cursor, end);
+        if (token == NULL || !parseInt(token, &object->text[i])) {
+            snprintf(object->error, sizeof(object->error), "bad machine code word %d", i);
+            return;
+        }
+    }
+    for (int i = 0; i < object->symbolTableSize; ++i) {
+        SymbolTableEntry *symbol = &object->symbolTable[i];
+        char *label = nextToken(&cursor, end);
+        char *type = nextToken(&cursor, end);
+        char *offset = nextToken(&cursor, end);
+        if (offset == NULL || strlen(type) != 1 || !parseInt(offset, &symbol->offset)) {
+            snprintf(object->error, sizeof(object->error), "bad symbol table entry %d", i);
+            return;
+        }
+        symbol->label = label;
+        symbol->type = type[0];
+        int sectionSize = symbol->type == 'T' ? object->textSize : object->dataSize;
+        if ((symbol->type != 'T' && symbol->type != 'D' && symbol->type != 'U') || !isGlobalLabel(label)
+            || (symbol->type != 'U' && (symbol->offset < 0 || symbol->offset >= sectionSize))) {
+            snprintf(object->error, sizeof(object->error), "bad symbol table entry for %s", label);
+            return;
+        }
+    }
+    for (int i = 0; i < object->relocationTableSize; ++i) {
+        RelocationTableEntry *relocation = &object->relocationTable[i];
+        char *offset = nextToken(&cursor, end);
+        relocation->opcode = nextToken(&cursor, end);
+        relocation->label = nextToken(&cursor, end);
+        if (relocation->label == NULL || !parseInt(offset, &relocation->offset)) {
+            snprintf(object->error, sizeof(object->error), "bad relocation table entry %d", i);
+            return;
+        }
+        int sectionSize = strcmp(relocation->opcode, ".fill") == 0 ? object->dataSize : object->textSize;
+        if (relocation->offset < 0 || relocation->offset >= sectionSize) {
+            snprintf(object->error, sizeof(object->error), "relocation entry %d (%s %s) is outside its section",
+                i, relocation->opcode, relocation->label);
+            return;
+        }
+    }
+}
+
+/*
+ * Rewrites every word named in the object's relocation table for the
+ * object's place in the linked program. A local label's address was
+ * assembled as if the object started at 0 with its data right after its
+ * text; a global label's address comes from the global table.
+ */
+void relocateObjectFile(ObjectFile *object) {
+    for (int i = 0; i < object->relocationTableSize; ++i) {
+        RelocationTableEntry *relocation = &object->relocationTable[i];
+        bool isFill = strcmp(relocation->opcode, ".fill") == 0;
+        int *word = isFill ? &object->data[relocation->offset] : &object->text[relocation->offset];
+        int oldAddress = isFill ? *word : (*word & 0xFFFF);
+        int address;
+        if (strcmp(relocation->label, "Stack") == 0) {
+            address = stackAddress;
+        }
+        else if (isGlobalLabel(relocation->label)) {
+            GlobalEntry *global = findGlobal(relocation->label);
+            if (global == NULL) {
+                snprintf(object->error, sizeof(object->error), "global label %s is not defined", relocation->label);
+                return;
+            }
+            address = global->address;
+        }
+        else if (oldAddress >= 0 && oldAddress < object->textSize) {
+            address = object->textStart + oldAddress;
+        }
+        else if (oldAddress >= object->textSize && oldAddress < object->textSize + object->dataSize) {
+            address = object->dataStart + oldAddress - object->textSize;
+        }
+        else {
+            snprintf(object->error, sizeof(object->error), "address %d of local label %s is outside the object",
+                oldAddress, relocation->label);
+            return;
+        }
+        if (isFill) {
+            *word = address;
+        }
+        else if (address > 32767) {
+            snprintf(object->error, sizeof(object->error),
+                "address %d of %s doesn't fit in the 16-bit offset field of %s at %d", address, relocation->label,
+                relocation->opcode, relocation->offset);
+            return;
+        }
+        else {
+            *word = (*word & ~0xFFFF) | address;
+        }
+    }
+}
+
+// Writes the linked program, one word per line
+void writeMachineCode(FILE *outFilePtr, ObjectFile *objects, int numObjects) {
+    static char buffer[1 << 16];
+    setvbuf(outFilePtr, buffer, _IOFBF, sizeof(buffer));
+    for (int i = 0; i < numObjects; ++i) {
+        for (int j = 0; j < objects[i].textSize; ++j) {
+            fprintf(outFilePtr, "%d\n", objects[i].text[j]);
+        }
+    }
+    for (int i = 0; i < numObjects; ++i) {
+        for (int j = 0; j < objects[i].dataSize; ++j) {
+            fprintf(outFilePtr, "%d\n", objects[i].data[j]);
+        }
+    }
+}
+
+// FNV-1a
+uint32_t hashString(const char *text) {
+    uint32_t hash = 2166136261u;
+    for (; *text != '\0'; ++text) {
+        hash = (hash ^ (unsigned char)*text) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns the global table entry for label, or NULL if no object defines it
+GlobalEntry *findGlobal(const char *label) {
+    uint32_t hash = hashString(label);
+    for (int i = hash & (globalTableCapacity - 1); globalTable[i].label != NULL;
+        i = (i + 1) & (globalTableCapacity - 1)) {
+        if (globalTable[i].hash == hash && strcmp(globalTable[i].label, label) == 0) {
+            return &globalTable[i];
+        }
+    }
+    return NULL;
+}
+
+// Adds a defined global label, returns false if it is already defined
+bool addGlobal(const char *label, int address, int fileIndex) {
+    uint32_t hash = hashString(label);
+    int i = hash & (globalTableCapacity - 1);
+    for (; globalTable[i].label != NULL; i = (i + 1) & (globalTableCapacity - 1)) {
+        if (globalTable[i].hash == hash && strcmp(globalTable[i].label, label) == 0) {
+            return false;
+        }
+    }
+    globalTable[i].label = label;
+    globalTable[i].hash = hash;
+    globalTable[i].address = address;
+    globalTable[i].fileIndex = fileIndex;
+    return true;
+}
+
+// Function to determine if a label is global
+bool isGlobalLabel(const char *label) {
+    return label[0] >= 'A' && label[0] <= 'Z';
+}
+
+// Folds size bytes into a 64-bit FNV-1a hash
+uint64_t hashBytes(uint64_t hash, const void *bytes, size_t size) {
+    const unsigned char *byte = bytes;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ byte[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Folds the length and bytes of a file into *hash, returns false if it can't be read
+bool hashFile(const char *fileString, uint64_t *hash) {
+    int fd = open(fileString, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    static unsigned char buffer[1 << 16];
+    uint64_t fileHash = *hash;
+    uint64_t length = 0;
+    ssize_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) > 0) {
+        fileHash = hashBytes(fileHash, buffer, count);
+        length += count;
+    }
+    close(fd);
+    if (count < 0) {
+        return false;
+    }
+    *hash = hashBytes(fileHash, &length, sizeof(length));
+    return true;
+}
+
+// Copies a file, returns false if it couldn't. toString isn't touched unless fromString opens.
+bool copyFile(const char *fromString, const char *toString) {
+    int from = open(fromString, O_RDONLY);
+    if (from < 0) {
+        return false;
+    }
+    int to = open(toString, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (to < 0) {
+        close(from);
+        return false;
+    }
+    static char buffer[1 << 16];
+    bool copied = true;
+    ssize_t count;
+    while (copied && (count = read(from, buffer, sizeof(buffer))) != 0) {
+        copied = count > 0 && write(to, buffer, count) == count;
+    }
+    close(from);
+    return close(to) == 0 && copied;
+}
+
+// Adds a linked program to the cache under a private name, then renames it into place, so another linker
+// reading the cache never sees part of one. A cache that can't be written is skipped.
+void storeInCache(const char *fileString, const char *cacheString) {
+    char tempString[MAXLINELENGTH + 64];
+    snprintf(tempString, sizeof(tempString), "%s.%ld", cacheString, (long)getpid());
+    if (!copyFile(fileString, tempString) || rename(tempString, cacheString) != 0) {
+        unlink(tempString);
+    }
+}
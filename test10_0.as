@@ -0,0 +1,10 @@
+	lw	0	1	Five
+	lw	0	2	Seven
+	add	1	2	3
+	sw	0	3	sum
+	lw	0	4	Ptr
+	lw	4	5	0
+	halt
+	.fill	3
+Five	.fill	5
+sum	.fill	0
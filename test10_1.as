@@ -0,0 +1,4 @@
+	noop
+	.fill	2
+Seven	.fill	7
+Ptr	.fill	Five